@@ -0,0 +1,306 @@
+/**
+MIT License
+Copyright (c) 2023 Adam Borocz
+*/
+#ifndef GUARD_B2F21AA6_53CA_4E73_9323_DE20E0DE9726_H_
+#define GUARD_B2F21AA6_53CA_4E73_9323_DE20E0DE9726_H_
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Small log-structured key-value store for state that needs to survive a reboot.
+ *
+ * The flash region is split into blocks which are used as a ring. Updates are appended to the
+ * current block as CRC-checked records. When a block fills up, the next block in the ring is
+ * erased and starts with a snapshot of every live value, followed by a commit record - so the
+ * newest committed block always holds the complete state, and erases are spread evenly over the
+ * whole region.
+ *
+ * `put()` only updates the in-memory copy; nothing touches flash until `flush()` is called, and
+ * values that didn't change aren't written again.
+ *
+ * `Flash` needs to provide:
+ *   uint32_t size();                                         // Total size of the region in bytes
+ *   uint32_t eraseSize();                                    // Erase granularity in bytes
+ *   void read(uint32_t offset, void* data, uint32_t length);
+ *   void write(uint32_t offset, const void* data, uint32_t length);  // 4-byte aligned, can only clear bits
+ *   void erase(uint32_t offset, uint32_t length);            // Aligned to `eraseSize()`, sets bytes to 0xFF
+ * See samdFlash.h for the on-device implementation.
+ */
+template <typename Flash>
+class FlashStore {
+ public:
+  static const uint8_t maxKeys = 8;
+  static const uint8_t maxValueSize = 16;
+
+  /**
+   * @param flash The flash backend to store records in
+   * @param blockSize Size of a single log block - must be a multiple of the erase size,
+   *   and the region needs to fit at least two of them
+  */
+  explicit FlashStore(Flash* flash, uint32_t blockSize = 1024) {
+    this->flash = flash;
+    this->blockSize = blockSize;
+    this->blockCount = flash->size() / blockSize;
+    hasBlock = false;
+    currentBlock = 0;
+    generation = 0;
+    writeOffset = 0;
+    memset(entries, 0, sizeof(entries));
+  }
+
+  /**
+   * Recover the latest state from flash. Safe to call on a blank or corrupted region.
+   * @return true if previously stored state was found
+  */
+  bool init() {
+    memset(entries, 0, sizeof(entries));
+    hasBlock = false;
+
+    if (blockCount < 2 || blockSize % flash->eraseSize() != 0) return false;
+
+    uint32_t bestGeneration = 0;
+    uint16_t bestBlock = 0;
+    for (uint16_t block = 0; block < blockCount; block++) {
+      uint32_t blockGeneration;
+      uint32_t endOffset;
+      if (!readBlockHeader(block, &blockGeneration)) continue;
+      if (hasBlock && blockGeneration <= bestGeneration) continue;
+      if (!replayBlock(block, false, &endOffset)) continue;  // Snapshot never completed
+
+      hasBlock = true;
+      bestGeneration = blockGeneration;
+      bestBlock = block;
+    }
+
+    if (!hasBlock) return false;
+
+    currentBlock = bestBlock;
+    generation = bestGeneration;
+    replayBlock(currentBlock, true, &writeOffset);
+    return true;
+  }
+
+  /**
+   * @return true if a value was found for `key` with exactly `length` bytes
+  */
+  bool get(uint8_t key, void* value, uint8_t length) {
+    if (maxKeys <= key || !entries[key].present || entries[key].length != length) return false;
+    memcpy(value, entries[key].data, length);
+    return true;
+  }
+
+  /**
+   * Stage a value to be written on the next `flush()`. Unchanged values are ignored.
+  */
+  bool put(uint8_t key, const void* value, uint8_t length) {
+    if (maxKeys <= key || maxValueSize < length) return false;
+
+    Entry* entry = &entries[key];
+    if (entry->present && entry->length == length && memcmp(entry->data, value, length) == 0) {
+      return true;
+    }
+
+    memcpy(entry->data, value, length);
+    entry->length = length;
+    entry->present = true;
+    entry->dirty = true;
+    return true;
+  }
+
+  bool isDirty() {
+    for (uint8_t key = 0; key < maxKeys; key++) {
+      if (entries[key].dirty) return true;
+    }
+    return false;
+  }
+
+  // Write out any values changed since the last flush
+  void flush() {
+    if (!isDirty()) return;
+
+    if (!hasBlock) {
+      startNextBlock();
+      return;
+    }
+
+    for (uint8_t key = 0; key < maxKeys; key++) {
+      if (!entries[key].dirty) continue;
+
+      if (blockSize < writeOffset + recordSize(entries[key].length)) {
+        startNextBlock();  // Snapshot includes every remaining dirty value
+        return;
+      }
+
+      appendRecord(key, entries[key].data, entries[key].length);
+      entries[key].dirty = false;
+    }
+  }
+
+  // How many blocks have been started since the region was first formatted
+  uint32_t getGeneration() {
+    return generation;
+  }
+
+ private:
+  static const uint32_t blockMagic = 0x52544157;  // "WATR"
+  static const uint32_t blockHeaderSize = 8;
+  static const uint8_t commitKey = 0xFE;
+  static const uint8_t blankKey = 0xFF;
+
+  struct Entry {
+    uint8_t data[maxValueSize];
+    uint8_t length;
+    bool present;
+    bool dirty;  // Changed since the last flush
+  };
+
+  Flash* flash;
+  uint32_t blockSize;
+  uint16_t blockCount;
+
+  bool hasBlock;  // Whether `currentBlock` holds a committed snapshot
+  uint16_t currentBlock;
+  uint32_t generation;
+  uint32_t writeOffset;  // Offset of the next record within `currentBlock`
+
+  Entry entries[maxKeys];
+
+  static uint32_t recordSize(uint8_t length) {
+    return 4 + ((length + 3) & ~3u);
+  }
+
+  static uint16_t crc16(uint16_t crc, const uint8_t* data, uint32_t length) {
+    // CRC-16/CCITT
+    for (uint32_t i = 0; i < length; i++) {
+      crc ^= static_cast<uint16_t>(data[i]) << 8;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+      }
+    }
+    return crc;
+  }
+
+  static uint16_t recordCrc(uint8_t key, const uint8_t* data, uint8_t length) {
+    const uint8_t header[2] = {key, length};
+    return crc16(crc16(0xFFFF, header, 2), data, length);
+  }
+
+  uint32_t blockAddress(uint16_t block) {
+    return static_cast<uint32_t>(block) * blockSize;
+  }
+
+  bool readBlockHeader(uint16_t block, uint32_t* blockGeneration) {
+    uint32_t header[2];
+    flash->read(blockAddress(block), header, sizeof(header));
+    // An all-ones generation means the header write was cut short
+    if (header[0] != blockMagic || header[1] == 0xFFFFFFFF) return false;
+    *blockGeneration = header[1];
+    return true;
+  }
+
+  bool isBlank(uint32_t address, uint32_t length) {
+    uint32_t word;
+    for (uint32_t offset = 0; offset < length; offset += 4) {
+      flash->read(address + offset, &word, 4);
+      if (word != 0xFFFFFFFF) return false;
+    }
+    return true;
+  }
+
+  /**
+   * Walk the records in a block, stopping at the first blank or damaged one.
+   * @param apply Whether to load the records into `entries`
+   * @param endOffset Set to where the next record can go - or the end of the block,
+   *   if it contains damage that we can't safely write after
+   * @return true if the block's snapshot was committed
+  */
+  bool replayBlock(uint16_t block, bool apply, uint32_t* endOffset) {
+    const uint32_t base = blockAddress(block);
+    bool committed = false;
+    uint32_t offset = blockHeaderSize;
+    uint8_t data[maxValueSize];
+
+    *endOffset = blockSize;
+
+    while (offset + 4 <= blockSize) {
+      uint8_t header[4];
+      flash->read(base + offset, header, 4);
+      const uint8_t key = header[0];
+      const uint8_t length = header[1];
+
+      if (key == blankKey && length == 0xFF && header[2] == 0xFF && header[3] == 0xFF) {
+        // Values are written before their header, so a torn write leaves junk past the end
+        if (isBlank(base + offset, blockSize - offset)) {
+          *endOffset = offset;
+        }
+        break;
+      }
+
+      if (maxValueSize < length || blockSize < offset + recordSize(length)) break;
+
+      flash->read(base + offset + 4, data, length);
+      const uint16_t crc = header[2] | (static_cast<uint16_t>(header[3]) << 8);
+      if (crc != recordCrc(key, data, length)) break;
+
+      if (key == commitKey) {
+        committed = true;
+      } else if (apply && key < maxKeys) {
+        memcpy(entries[key].data, data, length);
+        entries[key].length = length;
+        entries[key].present = true;
+        entries[key].dirty = false;
+      }
+
+      offset += recordSize(length);
+    }
+
+    return committed;
+  }
+
+  void appendRecord(uint8_t key, const uint8_t* data, uint8_t length) {
+    const uint32_t address = blockAddress(currentBlock) + writeOffset;
+    const uint16_t crc = recordCrc(key, data, length);
+    const uint8_t header[4] = {
+      key, length, static_cast<uint8_t>(crc & 0xFF), static_cast<uint8_t>(crc >> 8)
+    };
+
+    if (0 < length) {
+      uint8_t padded[maxValueSize];
+      const uint32_t paddedLength = recordSize(length) - 4;
+      memset(padded, 0xFF, sizeof(padded));
+      memcpy(padded, data, length);
+      flash->write(address + 4, padded, paddedLength);
+    }
+    flash->write(address, header, 4);  // Header last, so a record only exists once it's complete
+
+    writeOffset += recordSize(length);
+  }
+
+  // Erase the next block in the ring and write a snapshot of all values to it
+  void startNextBlock() {
+    const uint16_t nextBlock = hasBlock ? (currentBlock + 1) % blockCount : 0;
+    const uint32_t header[2] = {blockMagic, generation + 1};
+
+    flash->erase(blockAddress(nextBlock), blockSize);
+    flash->write(blockAddress(nextBlock), header, sizeof(header));
+
+    currentBlock = nextBlock;
+    generation++;
+    writeOffset = blockHeaderSize;
+
+    for (uint8_t key = 0; key < maxKeys; key++) {
+      if (entries[key].present) {
+        appendRecord(key, entries[key].data, entries[key].length);
+      }
+    }
+    appendRecord(commitKey, NULL, 0);
+    hasBlock = true;
+
+    for (uint8_t key = 0; key < maxKeys; key++) {
+      entries[key].dirty = false;
+    }
+  }
+};
+
+#endif  // GUARD_B2F21AA6_53CA_4E73_9323_DE20E0DE9726_H_
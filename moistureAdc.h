@@ -0,0 +1,218 @@
+/**
+MIT License
+Copyright (c) 2023 Adam Borocz
+*/
+#ifndef GUARD_54E47BB0_1BAF_4A1D_8CEE_29AE0D739BED_H_
+#define GUARD_54E47BB0_1BAF_4A1D_8CEE_29AE0D739BED_H_
+#include <Arduino.h>
+#include <wiring_private.h>
+
+const int PROGMEM moistureAdcMaxChannels = 4;  // Longest input scan we'll set up
+const int PROGMEM moistureAdcSamplesPerChannel = 8;  // Averaged into each reading
+const int PROGMEM moistureAdcDmaChannel = 0;
+const int PROGMEM moistureAdcBlockLength = moistureAdcMaxChannels * moistureAdcSamplesPerChannel;
+
+// The DMAC reads descriptors from SRAM, and needs them 16-byte aligned
+__attribute__((__aligned__(16))) static DmacDescriptor moistureAdcDescriptors[moistureAdcDmaChannel + 1];
+__attribute__((__aligned__(16))) static DmacDescriptor moistureAdcWriteback[moistureAdcDmaChannel + 1];
+__attribute__((__aligned__(16))) static DmacDescriptor moistureAdcSecondDescriptor;
+
+/**
+ * Samples all moisture pins in the background, instead of a blocking `analogRead()` per sensor.
+ *
+ * The ADC runs free in scan mode over the sensors' AIN channels, and the DMAC copies every result
+ * into one of two buffers, flipping between them after each block. Readers only ever look at the
+ * last completed block, so getting a value costs a few additions rather than a conversion + delay.
+ *
+ * Limitations:
+ *   - Pins must map to AIN channels no more than `moistureAdcMaxChannels` apart, since the ADC can
+ *     only scan a consecutive range (A5/A6 on the MKR are AIN6/AIN7)
+ *   - Nothing else can use `analogRead()` or the DMAC while this is running
+ *
+ * This header doesn't define `DMAC_Handler` or `MoistureAdc::instance` - the sketch owns those
+ * (see waterer.ino), so libraries with their own DMAC handler still link.
+*/
+class MoistureAdc {
+ public:
+  MoistureAdc() {
+    running = false;
+    completedBlocks = 0;
+    channelCount = 0;
+    scanLength = 0;
+  }
+
+  /**
+   * Configure the ADC & DMAC and start sampling.
+   * @param pins The analogue pins to sample - a sensor's channel is its index in this array
+   * @param count Number of pins
+   * @return false if the pins can't be scanned together or the DMAC is already in use,
+   *   in which case sensors should carry on with `analogRead()`
+  */
+  bool init(const int* pins, int count) {
+    if (count < 1 || moistureAdcMaxChannels < count) return false;
+
+    int firstAin = 255;
+    int lastAin = 0;
+    for (int i = 0; i < count; i++) {
+      const int ain = g_APinDescription[pins[i]].ulADCChannelNumber;
+      if (ain == No_ADC_Channel) return false;
+      if (ain < firstAin) firstAin = ain;
+      if (lastAin < ain) lastAin = ain;
+    }
+
+    scanLength = lastAin - firstAin + 1;
+    if (moistureAdcMaxChannels < scanLength) return false;
+
+    for (int i = 0; i < count; i++) {
+      scanSlot[i] = g_APinDescription[pins[i]].ulADCChannelNumber - firstAin;
+      pinPeripheral(pins[i], PIO_ANALOG);
+    }
+    channelCount = count;
+
+    PM->AHBMASK.reg |= PM_AHBMASK_DMAC;
+    PM->APBBMASK.reg |= PM_APBBMASK_DMAC;
+    if (DMAC->CTRL.bit.DMAENABLE) return false;  // Someone else has set it up already
+
+    instance = this;
+    setUpDma();
+    startAdc(firstAin);
+
+    // Make sure there's always a completed block to read from once we report success
+    const unsigned long startMillis = millis();
+    while (completedBlocks == 0) {
+      if (100 < millis() - startMillis) {
+        stop();
+        return false;
+      }
+    }
+
+    running = true;
+    return true;
+  }
+
+  bool isRunning() {
+    return running;
+  }
+
+  /**
+   * @param channel Index of the pin passed to `init()`
+   * @return Mean of the channel's samples in the last completed block (0 - 1023)
+  */
+  int getLatest(int channel) {
+    if (!running || channel < 0 || channelCount <= channel) return 0;
+
+    uint32_t blockNumber;
+    uint32_t sum;
+    do {  // Start over if the DMA finished another block while we were reading
+      blockNumber = completedBlocks;
+      const volatile uint16_t* block = buffers[(blockNumber - 1) % 2];
+      sum = 0;
+      for (int sample = 0; sample < moistureAdcSamplesPerChannel; sample++) {
+        sum += block[sample * scanLength + scanSlot[channel]];
+      }
+    } while (blockNumber != completedBlocks);
+
+    return sum / moistureAdcSamplesPerChannel;
+  }
+
+  // Called from the DMAC interrupt
+  static void onTransferComplete() {
+    DMAC->CHID.reg = DMAC_CHID_ID(moistureAdcDmaChannel);
+    if (DMAC->CHINTFLAG.bit.TCMPL) {
+      DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_TCMPL;
+      if (instance != NULL) instance->completedBlocks++;
+    }
+  }
+
+ private:
+  static MoistureAdc* instance;
+
+  bool running;
+  volatile uint32_t completedBlocks;  // Block N lands in buffers[(N - 1) % 2]
+  int channelCount;
+  int scanLength;  // Number of AIN channels in the scan, including any gaps between our pins
+  int scanSlot[moistureAdcMaxChannels];  // Position of each channel within a scan
+  volatile uint16_t buffers[2][moistureAdcBlockLength];
+
+  static void syncAdc() {
+    while (ADC->STATUS.bit.SYNCBUSY) {}
+  }
+
+  void setUpDma() {
+    // Only use whole scans, so each sample lands in the same slot every time
+    const uint16_t blockLength = scanLength * moistureAdcSamplesPerChannel;
+    DmacDescriptor* descriptors[2] = {&moistureAdcDescriptors[moistureAdcDmaChannel], &moistureAdcSecondDescriptor};
+
+    DMAC->BASEADDR.reg = (uint32_t)moistureAdcDescriptors;
+    DMAC->WRBADDR.reg = (uint32_t)moistureAdcWriteback;
+    DMAC->CTRL.reg = DMAC_CTRL_DMAENABLE | DMAC_CTRL_LVLEN(0xf);
+
+    DMAC->CHID.reg = DMAC_CHID_ID(moistureAdcDmaChannel);
+    DMAC->CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+    DMAC->CHCTRLA.reg = DMAC_CHCTRLA_SWRST;
+    while (DMAC->CHCTRLA.bit.SWRST) {}
+    DMAC->CHCTRLB.reg = DMAC_CHCTRLB_LVL(0)
+      | DMAC_CHCTRLB_TRIGSRC(ADC_DMAC_ID_RESRDY)
+      | DMAC_CHCTRLB_TRIGACT_BEAT;
+    DMAC->CHINTENSET.reg = DMAC_CHINTENSET_TCMPL;
+
+    // Two descriptors pointing at each other, so the DMA keeps flipping between the buffers
+    for (int i = 0; i < 2; i++) {
+      descriptors[i]->BTCTRL.reg = DMAC_BTCTRL_VALID
+        | DMAC_BTCTRL_BEATSIZE_HWORD
+        | DMAC_BTCTRL_DSTINC
+        | DMAC_BTCTRL_BLOCKACT_INT;
+      descriptors[i]->BTCNT.reg = blockLength;
+      descriptors[i]->SRCADDR.reg = (uint32_t)&ADC->RESULT.reg;
+      descriptors[i]->DSTADDR.reg = (uint32_t)(buffers[i] + blockLength);  // End address when incrementing
+      descriptors[i]->DESCADDR.reg = (uint32_t)descriptors[(i + 1) % 2];
+    }
+
+    NVIC_EnableIRQ(DMAC_IRQn);
+    DMAC->CHCTRLA.reg = DMAC_CHCTRLA_ENABLE;
+  }
+
+  void startAdc(int firstAin) {
+    // Clock, prescaler, reference & resolution are left as the core set them up for `analogRead()`
+    ADC->CTRLA.bit.ENABLE = 0;
+    syncAdc();
+    ADC->INPUTCTRL.bit.MUXPOS = firstAin;
+    syncAdc();
+    ADC->INPUTCTRL.bit.INPUTSCAN = scanLength - 1;
+    syncAdc();
+    ADC->INPUTCTRL.bit.INPUTOFFSET = 0;
+    syncAdc();
+    ADC->CTRLB.bit.FREERUN = 1;
+    syncAdc();
+    ADC->INTFLAG.reg = ADC_INTFLAG_RESRDY;
+
+    ADC->CTRLA.bit.ENABLE = 1;
+    syncAdc();
+    ADC->SWTRIG.bit.START = 1;
+    syncAdc();
+  }
+
+  // Hand the ADC back in the state `analogRead()` expects, and the DMAC back as we found it
+  void stop() {
+    NVIC_DisableIRQ(DMAC_IRQn);
+    DMAC->CHID.reg = DMAC_CHID_ID(moistureAdcDmaChannel);
+    DMAC->CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+    DMAC->CHINTENCLR.reg = DMAC_CHINTENCLR_TCMPL;
+    DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_TCMPL;
+    DMAC->CTRL.reg &= ~DMAC_CTRL_DMAENABLE;  // init() bails out if it was already enabled
+    instance = NULL;
+
+    ADC->CTRLA.bit.ENABLE = 0;
+    syncAdc();
+    ADC->CTRLB.bit.FREERUN = 0;
+    syncAdc();
+    ADC->INPUTCTRL.bit.INPUTSCAN = 0;
+    syncAdc();
+    ADC->INPUTCTRL.bit.INPUTOFFSET = 0;
+    syncAdc();
+
+    running = false;
+  }
+};
+
+#endif  // GUARD_54E47BB0_1BAF_4A1D_8CEE_29AE0D739BED_H_
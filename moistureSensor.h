@@ -4,6 +4,7 @@ Copyright (c) 2023 Adam Borocz
 */
 #ifndef GUARD_E513344B_9711_4050_80AC_C4B095D3F0B3_H_
 #define GUARD_E513344B_9711_4050_80AC_C4B095D3F0B3_H_
+#include "moistureAdc.h"
 
 class MoistureSensor {
  public:
@@ -23,11 +24,22 @@ class MoistureSensor {
     this->lowestVal = 1023;
 
     this->pin = pin;
+    this->adc = NULL;
+    this->adcChannel = 0;
+  }
+
+  /**
+   * Read from a background acquisition engine instead of calling `analogRead()`
+   * @param adc The engine sampling this sensor's pin
+   * @param channel The index of this sensor's pin in the engine
+  */
+  void attachAdc(MoistureAdc* adc, int channel) {
+    this->adc = adc;
+    this->adcChannel = channel;
   }
 
   int getValue() {
-    const int rawVal = analogRead(this->pin);
-    delay(10);  // To let the AD converter recover
+    const int rawVal = readRaw();
 
     if (rawVal < this->lowestVal) {
       this->lowestVal = rawVal;
@@ -60,12 +72,38 @@ class MoistureSensor {
     }
   }
 
+  int readRaw() {
+    if (adc != NULL && adc->isRunning()) {
+      return adc->getLatest(adcChannel);
+    }
+
+    const int rawVal = analogRead(this->pin);
+    delay(10);  // To let the AD converter recover
+    return rawVal;
+  }
+
+  int getLowestVal() {
+    return lowestVal;
+  }
+
+  int getHighestVal() {
+    return highestVal;
+  }
+
+  // Carry the observed range over from a previous run (see WatererController::restoreState())
+  void restoreObservedRange(int lowestVal, int highestVal) {
+    if (lowestVal < this->lowestVal) this->lowestVal = lowestVal;
+    if (this->highestVal < highestVal) this->highestVal = highestVal;
+  }
+
  private:
   int pin;
+  MoistureAdc* adc;  // Optional - NULL if we're sampling ourselves
+  int adcChannel;
   int maxValue;  // The expected highest reading - used to map to percentage
   int minValue;  // The expected lowest reading - used to map to a percentage
-  int highestVal;  // The highest reading observed since startup
-  int lowestVal;  // The lowest reading observed since startup
+  int highestVal;  // The highest reading observed, carried over reboots via restoreObservedRange()
+  int lowestVal;  // The lowest reading observed, carried over reboots via restoreObservedRange()
 };
 
 #endif  // GUARD_E513344B_9711_4050_80AC_C4B095D3F0B3_H_
@@ -0,0 +1,76 @@
+/**
+MIT License
+Copyright (c) 2023 Adam Borocz
+*/
+#ifndef GUARD_A241C93A_D4E8_48A0_B3EA_1FD21538E286_H_
+#define GUARD_A241C93A_D4E8_48A0_B3EA_1FD21538E286_H_
+#include <Arduino.h>
+
+// The MKR's SAMD21G18 doesn't have the separate RWW EEPROM section, so we reserve
+// a row-aligned chunk of the main flash instead (same trick as the FlashStorage library).
+// Note that this gets wiped whenever a new sketch is uploaded.
+const uint32_t PROGMEM samdFlashPageSize = 64;  // Write granularity
+const uint32_t PROGMEM samdFlashRowSize = 256;  // Erase granularity (4 pages)
+const uint32_t PROGMEM samdFlashRegionSize = 8192;
+
+__attribute__((__aligned__(256)))
+static const uint8_t samdFlashRegion[samdFlashRegionSize] = { };
+
+class SamdFlash {
+ public:
+  uint32_t size() {
+    return samdFlashRegionSize;
+  }
+
+  uint32_t eraseSize() {
+    return samdFlashRowSize;
+  }
+
+  void read(uint32_t offset, void* data, uint32_t length) {
+    // Volatile, so the compiler doesn't assume the (zero initialised) const array never changes
+    const volatile uint8_t* src = samdFlashRegion + offset;
+    uint8_t* dst = static_cast<uint8_t*>(data);
+    for (uint32_t i = 0; i < length; i++) {
+      dst[i] = src[i];
+    }
+  }
+
+  // `offset` and `length` need to be multiples of 4
+  void write(uint32_t offset, const void* data, uint32_t length) {
+    volatile uint32_t* dst = (volatile uint32_t*)(samdFlashRegion + offset);
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+
+    NVMCTRL->CTRLB.bit.MANW = 1;  // We trigger page writes ourselves
+
+    while (0 < length) {
+      runCommand(NVMCTRL_CTRLA_CMD_PBC);  // Page buffer clear - unwritten words stay 0xFF
+
+      // Fill the page buffer up to the end of the current page
+      do {
+        uint32_t word;
+        memcpy(&word, src, 4);  // `data` isn't necessarily word aligned
+        *dst++ = word;
+        src += 4;
+        length -= 4;
+      } while (0 < length && ((uint32_t)dst % samdFlashPageSize) != 0);
+
+      runCommand(NVMCTRL_CTRLA_CMD_WP);
+    }
+  }
+
+  // `offset` and `length` need to be multiples of the row size
+  void erase(uint32_t offset, uint32_t length) {
+    for (uint32_t row = 0; row < length; row += samdFlashRowSize) {
+      NVMCTRL->ADDR.reg = ((uint32_t)(samdFlashRegion + offset + row)) / 2;  // Word address
+      runCommand(NVMCTRL_CTRLA_CMD_ER);
+    }
+  }
+
+ private:
+  void runCommand(uint32_t command) {
+    NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | command;
+    while (!NVMCTRL->INTFLAG.bit.READY) {}
+  }
+};
+
+#endif  // GUARD_A241C93A_D4E8_48A0_B3EA_1FD21538E286_H_
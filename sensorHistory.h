@@ -0,0 +1,186 @@
+/**
+MIT License
+Copyright (c) 2023 Adam Borocz
+*/
+#ifndef GUARD_8821676E_8CC0_466C_83A0_E53B2F6E9124_H_
+#define GUARD_8821676E_8CC0_466C_83A0_E53B2F6E9124_H_
+#include <stdint.h>
+
+const int PROGMEM historyTierCount = 3;
+// Tier 0: last hour by minute, tier 1: last day by 15 minutes, tier 2: last 3 days by hour
+const int PROGMEM historyMinuteCapacity = 60;
+const int PROGMEM historyQuarterHourCapacity = 96;
+const int PROGMEM historyHourCapacity = 72;
+const int PROGMEM historyTierCapacity[historyTierCount] = {
+  historyMinuteCapacity, historyQuarterHourCapacity, historyHourCapacity
+};
+const int PROGMEM historyTotalCapacity = historyMinuteCapacity + historyQuarterHourCapacity + historyHourCapacity;
+const unsigned long PROGMEM historyTierBucketMs[historyTierCount] = {60000, 900000, 3600000};
+const int PROGMEM historyBucketsPerParent[historyTierCount] = {15, 4, 1};  // Buckets that make up one in the next tier
+
+// A decimated stretch of samples - all values are percentages
+struct HistoryBucket {
+  uint8_t minPct;
+  uint8_t maxPct;
+  uint8_t meanPct;  // `SensorHistory::noData` if there were no samples in this bucket
+};
+
+/**
+ * Fixed-size multi-resolution history for a single percentage reading.
+ *
+ * Samples are folded into the current one minute bucket as they arrive. Each completed bucket
+ * is pushed into its tier's ring buffer and merged into the open bucket of the next tier up,
+ * so every tier stays up to date without ever going back over old data.
+ */
+class SensorHistory {
+ public:
+  static const uint8_t noData = 0xFF;
+
+  SensorHistory() {
+    hasSample = false;
+    currentMinute = 0;
+    for (int tier = 0; tier < historyTierCount; tier++) {
+      head[tier] = 0;
+      count[tier] = 0;
+      version[tier] = 0;
+      childCount[tier] = 0;
+      resetAccumulator(tier);
+    }
+  }
+
+  void addSample(int pct, unsigned long nowMs) {
+    const unsigned long minute = nowMs / historyTierBucketMs[0];
+
+    if (!hasSample) {
+      hasSample = true;
+      currentMinute = minute;
+    } else if (minute != currentMinute) {
+      // Close the current minute, plus an empty one for each minute we got no samples in
+      // (no point going further back than the whole history covers)
+      const unsigned long maxGap = historyTierCapacity[historyTierCount - 1] * historyTierBucketMs[historyTierCount - 1]
+        / historyTierBucketMs[0];
+      unsigned long elapsed = (currentMinute < minute) ? minute - currentMinute : 1;  // millis() wrapped
+      if (maxGap < elapsed) elapsed = maxGap;
+
+      closeBucket(0);
+      for (unsigned long i = 1; i < elapsed; i++) {
+        closeBucket(0);  // Accumulator is empty at this point
+      }
+      currentMinute = minute;
+    }
+
+    const uint8_t value = (pct < 0) ? 0 : (100 < pct) ? 100 : pct;
+    mergeIntoAccumulator(0, value, value, value);
+  }
+
+  // Number of completed buckets available in a tier
+  int getBucketCount(int tier) {
+    return count[tier];
+  }
+
+  /**
+   * @param age 0 for the most recently completed bucket, 1 for the one before that, etc.
+  */
+  HistoryBucket getBucket(int tier, int age) {
+    const int capacity = historyTierCapacity[tier];
+    return buckets[tierOffset(tier) + (head[tier] + capacity - 1 - age) % capacity];
+  }
+
+  // Incremented every time a tier gets a new bucket - use to check whether a redraw is needed
+  uint32_t getVersion(int tier) {
+    return version[tier];
+  }
+
+  /**
+   * Pick the finest tier that covers `windowMs` in no more than `maxBuckets` buckets -
+   * falling back to the coarsest tier if none do.
+  */
+  int tierForWindow(unsigned long windowMs, int maxBuckets) {
+    for (int tier = 0; tier < historyTierCount; tier++) {
+      const unsigned long bucketsInWindow = windowMs / historyTierBucketMs[tier];
+      if (bucketsInWindow <= static_cast<unsigned long>(historyTierCapacity[tier])
+          && bucketsInWindow <= static_cast<unsigned long>(maxBuckets)) {
+        return tier;
+      }
+    }
+    return historyTierCount - 1;
+  }
+
+ private:
+  struct Accumulator {
+    uint8_t minPct;
+    uint8_t maxPct;
+    uint32_t sum;
+    uint16_t samples;
+  };
+
+  HistoryBucket buckets[historyTotalCapacity];
+  int head[historyTierCount];  // Where the next completed bucket goes in each tier
+  int count[historyTierCount];
+  uint32_t version[historyTierCount];
+  int childCount[historyTierCount];  // Buckets merged into the open bucket from the tier below
+  Accumulator accumulators[historyTierCount];  // The open bucket of each tier
+
+  bool hasSample;
+  unsigned long currentMinute;
+
+  static int tierOffset(int tier) {
+    int offset = 0;
+    for (int i = 0; i < tier; i++) {
+      offset += historyTierCapacity[i];
+    }
+    return offset;
+  }
+
+  void resetAccumulator(int tier) {
+    accumulators[tier].minPct = 100;
+    accumulators[tier].maxPct = 0;
+    accumulators[tier].sum = 0;
+    accumulators[tier].samples = 0;
+  }
+
+  void mergeIntoAccumulator(int tier, uint8_t minPct, uint8_t maxPct, uint8_t meanPct) {
+    Accumulator* acc = &accumulators[tier];
+    if (minPct < acc->minPct) acc->minPct = minPct;
+    if (acc->maxPct < maxPct) acc->maxPct = maxPct;
+    if (acc->samples == UINT16_MAX) {  // Keep the mean, but make room for more samples
+      acc->sum /= 2;
+      acc->samples /= 2;
+    }
+    acc->sum += meanPct;
+    acc->samples++;
+  }
+
+  // Push the open bucket of `tier` into its ring buffer, and cascade it up to the next tier
+  void closeBucket(int tier) {
+    const Accumulator& acc = accumulators[tier];
+    HistoryBucket bucket;
+    if (acc.samples == 0) {
+      bucket.minPct = noData;
+      bucket.maxPct = noData;
+      bucket.meanPct = noData;
+    } else {
+      bucket.minPct = acc.minPct;
+      bucket.maxPct = acc.maxPct;
+      bucket.meanPct = acc.sum / acc.samples;
+    }
+    resetAccumulator(tier);
+
+    buckets[tierOffset(tier) + head[tier]] = bucket;
+    head[tier] = (head[tier] + 1) % historyTierCapacity[tier];
+    if (count[tier] < historyTierCapacity[tier]) count[tier]++;
+    version[tier]++;
+
+    if (tier + 1 < historyTierCount) {
+      if (bucket.meanPct != noData) {
+        mergeIntoAccumulator(tier + 1, bucket.minPct, bucket.maxPct, bucket.meanPct);
+      }
+      if (historyBucketsPerParent[tier] <= ++childCount[tier + 1]) {
+        childCount[tier + 1] = 0;
+        closeBucket(tier + 1);
+      }
+    }
+  }
+};
+
+#endif  // GUARD_8821676E_8CC0_466C_83A0_E53B2F6E9124_H_
@@ -0,0 +1,138 @@
+/**
+MIT License
+Copyright (c) 2023 Adam Borocz
+*/
+#ifndef GUARD_26B0DA7D_E3C8_48B6_B90E_7861C33B2E0F_H_
+#define GUARD_26B0DA7D_E3C8_48B6_B90E_7861C33B2E0F_H_
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Thrown when the write budget runs out, to simulate the power being cut
+class PowerLoss : public std::runtime_error {
+ public:
+  PowerLoss() : std::runtime_error("power lost") {}
+};
+
+/**
+ * Host-side stand-in for `SamdFlash`, backed by an image file.
+ *
+ * Behaves like NOR flash: writes can only clear bits, and only an erase sets them back.
+ * Every word written and every row erased is pushed straight to the file, so the image
+ * always reflects what would have survived if the power was cut at that point.
+ */
+class FileFlash {
+ public:
+  /**
+   * @param path Image file - created (zero filled, like the on-device region) if it doesn't exist
+   * @param size Size of the region in bytes
+   * @param eraseSize Erase granularity in bytes
+  */
+  FileFlash(const std::string& path, uint32_t size = 8192, uint32_t eraseSize = 256)
+      : image(size, 0x00) {
+    this->regionSize = size;
+    this->rowSize = eraseSize;
+    this->writeBudget = -1;
+    this->eraseCount.assign(size / eraseSize, 0);
+
+    file = fopen(path.c_str(), "r+b");
+    if (file == NULL) {
+      file = fopen(path.c_str(), "w+b");
+      if (file == NULL) throw std::runtime_error("Could not create image " + path);
+      fwrite(image.data(), 1, size, file);
+      fflush(file);
+    } else if (fread(image.data(), 1, size, file) != size) {
+      fclose(file);
+      throw std::runtime_error("Image " + path + " is too small");
+    }
+  }
+
+  ~FileFlash() {
+    fclose(file);
+  }
+
+  FileFlash(const FileFlash&) = delete;
+  FileFlash& operator=(const FileFlash&) = delete;
+
+  uint32_t size() {
+    return regionSize;
+  }
+
+  uint32_t eraseSize() {
+    return rowSize;
+  }
+
+  /**
+   * Limit how many more word writes/row erases succeed before `PowerLoss` is thrown.
+   * @param operations Number of operations, or -1 for no limit
+  */
+  void setWriteBudget(long operations) {
+    writeBudget = operations;
+  }
+
+  // How many times each row has been erased - for checking wear levelling
+  const std::vector<uint32_t>& getEraseCounts() {
+    return eraseCount;
+  }
+
+  void read(uint32_t offset, void* data, uint32_t length) {
+    checkRange(offset, length);
+    memcpy(data, image.data() + offset, length);
+  }
+
+  void write(uint32_t offset, const void* data, uint32_t length) {
+    checkRange(offset, length);
+    if (offset % 4 != 0 || length % 4 != 0) throw std::logic_error("Unaligned flash write");
+
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    for (uint32_t i = 0; i < length; i += 4) {
+      spendBudget();
+      for (uint32_t j = 0; j < 4; j++) {
+        image[offset + i + j] &= src[i + j];
+      }
+      persist(offset + i, 4);
+    }
+  }
+
+  void erase(uint32_t offset, uint32_t length) {
+    checkRange(offset, length);
+    if (offset % rowSize != 0 || length % rowSize != 0) throw std::logic_error("Unaligned flash erase");
+
+    for (uint32_t row = offset; row < offset + length; row += rowSize) {
+      spendBudget();
+      memset(image.data() + row, 0xFF, rowSize);
+      eraseCount[row / rowSize]++;
+      persist(row, rowSize);
+    }
+  }
+
+ private:
+  FILE* file;
+  std::vector<uint8_t> image;
+  std::vector<uint32_t> eraseCount;
+  uint32_t regionSize;
+  uint32_t rowSize;
+  long writeBudget;
+
+  void checkRange(uint32_t offset, uint32_t length) {
+    if (regionSize < offset || regionSize - offset < length) {
+      throw std::out_of_range("Flash access out of range");
+    }
+  }
+
+  void spendBudget() {
+    if (writeBudget == 0) throw PowerLoss();
+    if (0 < writeBudget) writeBudget--;
+  }
+
+  void persist(uint32_t offset, uint32_t length) {
+    fseek(file, offset, SEEK_SET);
+    fwrite(image.data() + offset, 1, length, file);
+    fflush(file);
+  }
+};
+
+#endif  // GUARD_26B0DA7D_E3C8_48B6_B90E_7861C33B2E0F_H_
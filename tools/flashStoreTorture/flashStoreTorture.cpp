@@ -0,0 +1,141 @@
+/**
+MIT License
+Copyright (c) 2023 Adam Borocz
+*/
+// Power loss torture test for FlashStore, run against a file-backed flash image.
+//
+// Each cycle "boots" the store from the image, checks that every key recovered either its last
+// durably flushed value or the value that was being flushed when the power went, then does a
+// random batch of updates with the power cut after a random number of flash operations.
+//
+// Build & run from the repository root:
+//   g++ -std=c++11 -O2 -Wall -I. tools/flashStoreTorture/flashStoreTorture.cpp -o flashStoreTorture
+//   ./flashStoreTorture [image path] [cycles] [seed]
+//
+// The image is a scratch file - whatever is at that path gets deleted and overwritten on every
+// run (default flashStoreTorture.img in the current directory).
+#include <stdio.h>
+#include <stdlib.h>
+#include <random>
+#include <string>
+#include <vector>
+#include "flashStore.h"
+#include "fileFlash.h"
+
+typedef FlashStore<FileFlash> Store;
+typedef std::vector<uint8_t> Value;
+
+struct KeyState {
+  bool hasDurable = false;
+  Value durable;  // Last value known to have been flushed completely
+  bool hasCandidate = false;
+  Value candidate;  // Value that was mid-flush when the power went
+};
+
+static bool checkRecovered(Store* store, std::vector<KeyState>* keys, long cycle) {
+  for (uint8_t key = 0; key < Store::maxKeys; key++) {
+    KeyState& state = (*keys)[key];
+    const Value* expected[2] = {
+      state.hasDurable ? &state.durable : NULL,
+      state.hasCandidate ? &state.candidate : NULL
+    };
+
+    const Value* match = NULL;
+    for (const Value* value : expected) {
+      if (value == NULL) continue;
+      Value recovered(value->size());
+      if (store->get(key, recovered.data(), recovered.size()) && recovered == *value) {
+        match = value;
+        break;
+      }
+    }
+
+    if (match == NULL && state.hasDurable) {
+      fprintf(stderr, "Cycle %ld: key %u lost its value\n", cycle, key);
+      return false;
+    }
+
+    if (match != NULL) {
+      state.durable = *match;
+      state.hasDurable = true;
+    }
+    state.hasCandidate = false;
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  const std::string imagePath = (1 < argc) ? argv[1] : "flashStoreTorture.img";
+  const long cycles = (2 < argc) ? atol(argv[2]) : 2000;
+  const unsigned seed = (3 < argc) ? static_cast<unsigned>(atol(argv[3])) : 1;
+
+  remove(imagePath.c_str());  // Scratch file, always start from blank flash
+
+  std::mt19937 rng(seed);
+  std::vector<KeyState> keys(Store::maxKeys);
+  long powerLosses = 0;
+  long flushes = 0;
+  uint32_t generation = 0;
+  std::vector<uint32_t> eraseCounts;
+
+  for (long cycle = 0; cycle < cycles; cycle++) {
+    FileFlash flash(imagePath);
+    Store store(&flash);
+    store.init();
+
+    if (!checkRecovered(&store, &keys, cycle)) return 1;
+    if (store.getGeneration() < generation) {
+      fprintf(stderr, "Cycle %ld: generation went backwards\n", cycle);
+      return 1;
+    }
+    generation = store.getGeneration();
+
+    // Let roughly one in ten cycles run to completion
+    flash.setWriteBudget((rng() % 10 == 0) ? -1 : static_cast<long>(rng() % 400));
+
+    try {
+      const int batches = 1 + rng() % 20;
+      for (int batch = 0; batch < batches; batch++) {
+        const int updates = 1 + rng() % 4;
+        for (int i = 0; i < updates; i++) {
+          const uint8_t key = rng() % Store::maxKeys;
+          Value value(1 + rng() % Store::maxValueSize);
+          for (uint8_t& byte : value) byte = rng();
+          store.put(key, value.data(), value.size());
+          keys[key].candidate = value;
+          keys[key].hasCandidate = true;
+        }
+
+        store.flush();
+        flushes++;
+        for (KeyState& state : keys) {
+          if (state.hasCandidate) {
+            state.durable = state.candidate;
+            state.hasDurable = true;
+            state.hasCandidate = false;
+          }
+        }
+      }
+    } catch (const PowerLoss&) {
+      powerLosses++;
+    }
+
+    const std::vector<uint32_t>& cycleErases = flash.getEraseCounts();
+    eraseCounts.resize(cycleErases.size(), 0);
+    for (size_t row = 0; row < cycleErases.size(); row++) {
+      eraseCounts[row] += cycleErases[row];
+    }
+  }
+
+  uint32_t minErases = UINT32_MAX;
+  uint32_t maxErases = 0;
+  for (uint32_t count : eraseCounts) {
+    if (count < minErases) minErases = count;
+    if (maxErases < count) maxErases = count;
+  }
+
+  printf("%ld cycles, %ld flushes, %ld power losses, %u blocks written\n",
+    cycles, flushes, powerLosses, generation);
+  printf("Erases per row: min %u, max %u\n", minErases, maxErases);
+  return 0;
+}
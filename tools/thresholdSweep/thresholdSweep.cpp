@@ -0,0 +1,286 @@
+/**
+MIT License
+Copyright (c) 2023 Adam Borocz
+*/
+// Tunes the WatererController thresholds against recorded sensor traces.
+//
+// Every combination of the parameter grid is simulated against every trace (spread across all
+// cores), then ranked by a weighted score of water used, time the plant spent too dry and pump
+// cycles - all per day, lower is better.
+//
+// The tank warn/critical percentages don't affect watering, so they aren't part of the grid.
+// Instead, each result shows how long the configured levels warn before the tank runs empty at
+// that configuration's water usage, and which levels would give the requested lead times.
+//
+// Record traces by saving the serial output of the sketch (TRACE lines, see printTrace()).
+//
+// Build & run from the repository root:
+//   g++ -std=c++11 -O2 -Wall -pthread -I. tools/thresholdSweep/thresholdSweep.cpp -o thresholdSweep
+//   ./thresholdSweep --threshold 30:70:5 --interval 30000:600000:30000 --duration 2000:10000:1000 trace1.log ...
+//
+// Grid values are given as a single value, a comma separated list or start:end:step.
+// Run with --help for the rest of the options.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "traceSimulator.h"
+#include "workStealingPool.h"
+
+struct Weights {
+  double waterPerLitre = 1;
+  double dryPerHour = 10;
+  double perPumpCycle = 0.05;
+};
+
+// How much warning the tank level statuses should give before the tank runs empty
+struct LeadTargets {
+  double warnHours = 168;
+  double criticalHours = 48;
+};
+
+struct Candidate {
+  PumpSettings settings;
+  SimulationResult result;
+  double score;
+  size_t index;  // Grid order, to keep ties in a stable order
+};
+
+static void printUsage() {
+  printf(
+    "Usage: thresholdSweep [options] trace...\n"
+    "\n"
+    "Grid (single value, a,b,c or start:end:step):\n"
+    "  --threshold <pct>      Moisture trigger threshold (default 30:70:5)\n"
+    "  --interval <ms>        Pump check interval (default 30000:600000:30000)\n"
+    "  --duration <ms>        Pump run duration (default 2000:10000:1000)\n"
+    "\n"
+    "Tank (reported per result, not part of the grid):\n"
+    "  --warn <pct>           Configured warn percentage (default 50)\n"
+    "  --critical <pct>       Configured critical percentage (default 25)\n"
+    "  --warn-lead <hours>    Wanted warning before the tank runs empty (default 168)\n"
+    "  --critical-lead <hours>  Wanted critical warning before it runs empty (default 48)\n"
+    "\n"
+    "Model:\n"
+    "  --plant <1|2>          Moisture channel to tune (default 1)\n"
+    "  --flow-rate <mL/s>     Pump flow rate (default 8)\n"
+    "  --gain <pct/mL>        Moisture gain per mL (default: estimated from the traces)\n"
+    "  --soak-time <ms>       Time for water to reach the sensor (default 120000)\n"
+    "  --tank <mL>            Tank capacity (default 2000)\n"
+    "  --recorded-duration <ms>  Pump run duration used while recording (default 5000)\n"
+    "  --dry <pct>            Moisture below this counts as too dry (default 30)\n"
+    "  --tick <ms>            Simulation step (default 1000)\n"
+    "\n"
+    "Ranking (score per day, lower is better):\n"
+    "  --w-water <n>          Weight per litre used (default 1)\n"
+    "  --w-dry <n>            Weight per hour too dry (default 10)\n"
+    "  --w-cycles <n>         Weight per pump cycle (default 0.05)\n"
+    "  --top <n>              Number of results to print (default 10)\n"
+    "  --threads <n>          Worker threads (default: one per core)\n");
+}
+
+static bool parseGrid(const char* spec, std::vector<long>* values) {
+  values->clear();
+  long start, end, step;
+  char extra;
+  if (sscanf(spec, "%ld:%ld:%ld%c", &start, &end, &step, &extra) == 3) {
+    if (step <= 0 || end < start) return false;
+    for (long value = start; value <= end; value += step) {
+      values->push_back(value);
+    }
+    return true;
+  }
+
+  const char* cursor = spec;
+  while (*cursor != '\0') {
+    char* next;
+    values->push_back(strtol(cursor, &next, 10));
+    if (next == cursor || (*next != ',' && *next != '\0')) return false;
+    cursor = (*next == ',') ? next + 1 : next;
+  }
+  return !values->empty();
+}
+
+// Hours until the tank goes from `pct` to empty at `mlPerHour`
+static double leadHours(const PlantModel& model, int pct, double mlPerHour) {
+  return model.tankMl * pct / 100 / mlPerHour;
+}
+
+// Lowest level that gives at least `hours` of warning at `mlPerHour`
+static int levelForLead(const PlantModel& model, double hours, double mlPerHour) {
+  return static_cast<int>(ceil(100 * hours * mlPerHour / model.tankMl));
+}
+
+static std::string formatLevel(int pct) {
+  return (100 <= pct) ? std::string(">99") : std::to_string(pct);
+}
+
+int main(int argc, char** argv) {
+  std::vector<long> thresholds, intervals, durations;
+  parseGrid("30:70:5", &thresholds);
+  parseGrid("30000:600000:30000", &intervals);
+  parseGrid("2000:10000:1000", &durations);
+
+  PlantModel model;
+  Weights weights;
+  LevelThresholds levels = {50, 25};
+  LeadTargets leadTargets;
+  bool estimateGain = true;
+  size_t top = 10;
+  unsigned threadCount = 0;
+  std::vector<std::string> tracePaths;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--help" || arg == "-h") {
+      printUsage();
+      return 0;
+    }
+    if (arg.compare(0, 2, "--") != 0) {
+      tracePaths.push_back(arg);
+      continue;
+    }
+    if (i + 1 == argc) {
+      fprintf(stderr, "Missing value for %s\n", arg.c_str());
+      return 1;
+    }
+
+    const char* value = argv[++i];
+    bool ok = true;
+    if (arg == "--threshold") ok = parseGrid(value, &thresholds);
+    else if (arg == "--interval") ok = parseGrid(value, &intervals);
+    else if (arg == "--duration") ok = parseGrid(value, &durations);
+    else if (arg == "--warn") levels.warnPercentage = atoi(value);
+    else if (arg == "--critical") levels.criticalPercentage = atoi(value);
+    else if (arg == "--warn-lead") leadTargets.warnHours = atof(value);
+    else if (arg == "--critical-lead") leadTargets.criticalHours = atof(value);
+    else if (arg == "--plant") model.plant = atoi(value) - 1;
+    else if (arg == "--flow-rate") model.pumpFlowRate = atof(value);
+    else if (arg == "--gain") { model.gainPerMl = atof(value); estimateGain = false; }
+    else if (arg == "--soak-time") model.soakTime = atol(value);
+    else if (arg == "--tank") model.tankMl = atof(value);
+    else if (arg == "--recorded-duration") model.recordedRunDuration = atol(value);
+    else if (arg == "--dry") model.dryPercentage = atoi(value);
+    else if (arg == "--tick") model.tickMs = atol(value);
+    else if (arg == "--w-water") weights.waterPerLitre = atof(value);
+    else if (arg == "--w-dry") weights.dryPerHour = atof(value);
+    else if (arg == "--w-cycles") weights.perPumpCycle = atof(value);
+    else if (arg == "--top") top = atol(value);
+    else if (arg == "--threads") threadCount = atoi(value);
+    else ok = false;
+
+    if (!ok) {
+      fprintf(stderr, "Invalid option: %s %s\n", arg.c_str(), value);
+      return 1;
+    }
+  }
+
+  if (tracePaths.empty()) {
+    printUsage();
+    return 1;
+  }
+  if ((model.plant != 0 && model.plant != 1) || model.tickMs <= 0 || model.soakTime <= 0 || model.tankMl <= 0) {
+    fprintf(stderr, "Invalid model options\n");
+    return 1;
+  }
+  // Otherwise the warn status could never show
+  if (levels.warnPercentage <= levels.criticalPercentage || levels.criticalPercentage < 0) {
+    fprintf(stderr, "--warn needs to be above --critical\n");
+    return 1;
+  }
+  if (leadTargets.warnHours <= leadTargets.criticalHours || leadTargets.criticalHours <= 0) {
+    fprintf(stderr, "--warn-lead needs to be longer than --critical-lead\n");
+    return 1;
+  }
+
+  std::vector<Trace> traces(tracePaths.size());
+  for (size_t i = 0; i < tracePaths.size(); i++) {
+    if (!loadTrace(tracePaths[i], &traces[i])) {
+      if (traces[i].samples.size() < 2) {
+        fprintf(stderr, "Could not read at least two TRACE lines from %s\n", tracePaths[i].c_str());
+      } else {
+        fprintf(stderr, "The TRACE lines in %s have no time span\n", tracePaths[i].c_str());
+      }
+      return 1;
+    }
+  }
+
+  if (estimateGain) {
+    model.gainPerMl = TraceSimulator::estimateGainPerMl(traces, model);
+    if (model.gainPerMl <= 0) {
+      fprintf(stderr, "Could not estimate the moisture gain from the traces - pass --gain\n");
+      return 1;
+    }
+  }
+
+  std::vector<TraceSimulator> simulators;
+  for (const Trace& trace : traces) {
+    simulators.emplace_back(trace, model);
+  }
+
+  std::vector<Candidate> candidates;
+  for (long threshold : thresholds)
+    for (long interval : intervals)
+      for (long duration : durations) {
+        Candidate candidate;
+        candidate.settings = {static_cast<int>(threshold), interval, duration};
+        candidate.index = candidates.size();
+        candidates.push_back(candidate);
+      }
+
+  WorkStealingPool pool(threadCount);
+  printf("Simulating %zu configurations x %zu traces on %u threads (gain %.3f%%/mL)\n",
+    candidates.size(), traces.size(), pool.getThreadCount(), model.gainPerMl);
+
+  pool.run(candidates.size(), [&](size_t index) {
+    Candidate& candidate = candidates[index];
+    for (const TraceSimulator& simulator : simulators) {
+      candidate.result.add(simulator.run(candidate.settings));
+    }
+
+    const double days = candidate.result.durationMs / 86400000.0;
+    candidate.score = (
+      weights.waterPerLitre * candidate.result.waterMl / 1000
+      + weights.dryPerHour * candidate.result.dryMs / 3600000
+      + weights.perPumpCycle * candidate.result.pumpCycles
+    ) / days;
+  });
+
+  top = std::min(top, candidates.size());
+  std::partial_sort(candidates.begin(), candidates.begin() + top, candidates.end(),
+    [](const Candidate& a, const Candidate& b) {
+      return (a.score != b.score) ? a.score < b.score : a.index < b.index;
+    });
+
+  printf("\n%4s %9s %10s %9s | %8s %8s %8s %6s | %8s | %10s %10s %8s %8s\n", "rank", "threshold", "interval",
+    "duration", "L/day", "dry h/d", "runs/day", "empty", "score", "warn lead", "crit lead", "warn @", "crit @");
+  for (size_t i = 0; i < top; i++) {
+    const Candidate& candidate = candidates[i];
+    const double days = candidate.result.durationMs / 86400000.0;
+    printf("%4zu %9d %10ld %9ld | %8.2f %8.2f %8.1f %6.0f | %8.3f |", i + 1,
+      candidate.settings.triggerThreshold, candidate.settings.checkInterval, candidate.settings.runDuration,
+      candidate.result.waterMl / 1000 / days, candidate.result.dryMs / 3600000 / days,
+      candidate.result.pumpCycles / days, candidate.result.emptyTankRuns, candidate.score);
+
+    const double mlPerHour = candidate.result.waterMl / (candidate.result.durationMs / 3600000);
+    if (mlPerHour <= 0) {
+      printf(" %10s %10s %8s %8s\n", "-", "-", "-", "-");
+      continue;
+    }
+
+    // Keep the suggested warn level above critical, even if rounding puts them together
+    const int critical = std::max(1, levelForLead(model, leadTargets.criticalHours, mlPerHour));
+    const int warn = std::max(critical + 1, levelForLead(model, leadTargets.warnHours, mlPerHour));
+    printf(" %9.0fh %9.0fh %7s%% %7s%%\n",
+      leadHours(model, levels.warnPercentage, mlPerHour), leadHours(model, levels.criticalPercentage, mlPerHour),
+      formatLevel(warn).c_str(), formatLevel(critical).c_str());
+  }
+
+  printf("\nLead = warning the configured %d%%/%d%% levels give before the tank runs empty.\n"
+    "warn @ / crit @ = levels giving %.0fh / %.0fh of warning.\n",
+    levels.warnPercentage, levels.criticalPercentage, leadTargets.warnHours, leadTargets.criticalHours);
+  return 0;
+}
@@ -0,0 +1,294 @@
+/**
+MIT License
+Copyright (c) 2023 Adam Borocz
+*/
+#ifndef GUARD_905EFA78_6AA0_4C70_B326_1D0F3BE172BA_H_
+#define GUARD_905EFA78_6AA0_4C70_B326_1D0F3BE172BA_H_
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "watererLogic.h"
+
+// One TRACE line from WatererController::printTrace()
+struct TraceSample {
+  long ms;
+  int moisturePct[2];
+  int waterLevelPct;
+  long pumpRuns[2];
+};
+
+struct Trace {
+  std::string name;
+  std::vector<TraceSample> samples;
+};
+
+/**
+ * Read the TRACE lines out of a captured serial log - anything else (including timestamps
+ * a serial monitor put in front of them) is skipped. Reboots are stitched together, so a
+ * trace can span several of them.
+ * @return false if the file couldn't be read, had fewer than two samples or they all have the
+ *   same time (check `trace->samples` to tell which)
+*/
+inline bool loadTrace(const std::string& path, Trace* trace) {
+  FILE* file = fopen(path.c_str(), "r");
+  if (file == NULL) return false;
+
+  trace->name = path;
+  trace->samples.clear();
+
+  char line[256];
+  long offsetMs = 0;  // Added to `millis()` values after a reboot
+  long lastRawMs = 0;
+  long lastIntervalMs = 60000;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    const char* start = strstr(line, "TRACE,");
+    if (start == NULL) continue;
+
+    TraceSample sample;
+    long rawMs;
+    if (sscanf(start, "TRACE,%ld,%d,%d,%d,%ld,%ld", &rawMs, &sample.moisturePct[0], &sample.moisturePct[1],
+        &sample.waterLevelPct, &sample.pumpRuns[0], &sample.pumpRuns[1]) != 6) {
+      continue;
+    }
+
+    if (!trace->samples.empty()) {
+      if (rawMs < lastRawMs) {
+        // Rebooted - we don't know how long it was off for, so assume one trace interval
+        offsetMs = trace->samples.back().ms + lastIntervalMs - rawMs;
+      } else {
+        lastIntervalMs = std::max(1L, rawMs - lastRawMs);
+      }
+    }
+    lastRawMs = rawMs;
+    sample.ms = rawMs + offsetMs;
+    trace->samples.push_back(sample);
+  }
+
+  fclose(file);
+  return 2 <= trace->samples.size() && trace->samples.front().ms < trace->samples.back().ms;
+}
+
+// How the plant & tank respond to watering - the parts the traces can't tell us directly
+struct PlantModel {
+  int plant = 0;  // Which moisture channel to use (0 or 1)
+  double pumpFlowRate = 8;  // mL/s
+  double gainPerMl = 0;  // Moisture percentage points per mL once it's soaked in - see estimateGainPerMl()
+  long soakTime = 120000;  // Time constant for water to reach the sensor, in ms
+  double tankMl = 2000;
+  long recordedRunDuration = 5000;  // Pump run duration in use when the traces were recorded
+  int dryPercentage = 30;  // Moisture below this counts as time spent too dry
+  long tickMs = 1000;  // Simulation step - roughly how often the controller loop would run
+};
+
+struct SimulationResult {
+  double waterMl = 0;
+  long pumpCycles = 0;
+  double dryMs = 0;  // Time spent below PlantModel::dryPercentage
+  double emptyTankRuns = 0;  // Pump runs with no water left in the tank
+  double durationMs = 0;  // Total trace time simulated
+
+  void add(const SimulationResult& other) {
+    waterMl += other.waterMl;
+    pumpCycles += other.pumpCycles;
+    dryMs += other.dryMs;
+    emptyTankRuns += other.emptyTankRuns;
+    durationMs += other.durationMs;
+  }
+};
+
+/**
+ * Replays a trace's drying curve against a different set of controller settings.
+ *
+ * The recorded moisture changes give us how fast the soil dries out between waterings. Segments
+ * affected by a recorded pump run are replaced with the trace's typical drying rate, and the
+ * simulated pump runs add their own water instead - soaking in gradually, which is what makes
+ * short check intervals overwater.
+ */
+class TraceSimulator {
+ public:
+  TraceSimulator(const Trace& trace, const PlantModel& model) : trace(trace), model(model) {
+    computeDryingRates();
+  }
+
+  /**
+   * Estimate moisture gain per mL from the rises following recorded pump runs.
+   *
+   * Runs that land within a few soak times of each other are one watering, and its rise is the
+   * gap between the drying lines either side of it. Fitting those lines over every reading rather
+   * than taking single samples gets below the sensor's 1% steps - which matter, since a run
+   * starts just as the moisture drops past the threshold. Rises & water are pooled over every
+   * watering in every trace.
+   * @return the pooled gain, or 0 if the traces have no waterings that raised the moisture
+  */
+  static double estimateGainPerMl(const std::vector<Trace>& traces, const PlantModel& model) {
+    double totalRise = 0;
+    double totalMl = 0;
+
+    for (const Trace& trace : traces) {
+      const std::vector<TraceSample>& samples = trace.samples;
+      const double dryingRate = TraceSimulator(trace, model).typicalRate;
+
+      // Each watering as [first, last] - the sample before its first run, and the last one within
+      // a few soak times of its last run
+      std::vector<size_t> firsts, lasts;
+      for (size_t i = 0; i + 1 < samples.size(); i++) {
+        if (samples[i + 1].pumpRuns[model.plant] <= samples[i].pumpRuns[model.plant]) continue;
+
+        if (lasts.empty() || lasts.back() < i) {
+          firsts.push_back(i);
+          lasts.push_back(i);
+        }
+        while (lasts.back() + 1 < samples.size() && samples[lasts.back() + 1].ms - samples[i].ms <= 3 * model.soakTime) {
+          lasts.back()++;
+        }
+      }
+
+      for (size_t k = 0; k < firsts.size(); k++) {
+        if (lasts[k] + 1 == samples.size()) continue;  // Trace ended before it had soaked in
+
+        // Drying either side, up to & including the sample before the next watering
+        const size_t dryBefore = (0 < k) ? lasts[k - 1] + 1 : 0;
+        const size_t dryAfter = (k + 1 < firsts.size()) ? firsts[k + 1] + 1 : samples.size();
+
+        const long ms = samples[firsts[k]].ms;
+        const double rise = meanLevelAt(samples, lasts[k] + 1, dryAfter, ms, dryingRate, model.plant)
+          - meanLevelAt(samples, dryBefore, firsts[k] + 1, ms, dryingRate, model.plant);
+        const long runs = samples[lasts[k]].pumpRuns[model.plant] - samples[firsts[k]].pumpRuns[model.plant];
+        totalRise += rise;
+        totalMl += runs * model.pumpFlowRate * model.recordedRunDuration / 1000.0;
+      }
+    }
+
+    return (0 < totalRise && 0 < totalMl) ? totalRise / totalMl : 0;
+  }
+
+  SimulationResult run(const PumpSettings& settings) const {
+    const std::vector<TraceSample>& samples = trace.samples;
+    SimulationResult result;
+
+    double moisture = samples[0].moisturePct[model.plant];
+    double pendingMl = 0;  // Water that's been pumped, but hasn't reached the sensor yet
+    double tankMl = model.tankMl * samples[0].waterLevelPct / 100.0;
+    const double soakFraction = std::min(1.0, static_cast<double>(model.tickMs) / model.soakTime);
+
+    // Same state as WatererController straight after a boot
+    bool pumpOn = false;
+    bool prevPumpOn = false;
+    long pumpOffAtMs = 0;
+    long lastRunMs = samples[0].ms;
+    long msSinceLastRun = 0;
+
+    size_t segment = 0;
+    for (long now = samples[0].ms; now < samples.back().ms; now += model.tickMs) {
+      while (samples[segment + 1].ms <= now) {
+        segment++;
+        // Big jump in the recorded level means the tank was refilled
+        if (samples[segment - 1].waterLevelPct + 20 <= samples[segment].waterLevelPct) {
+          tankMl = model.tankMl * samples[segment].waterLevelPct / 100.0;
+        }
+      }
+
+      moisture += dryingRates[segment] * model.tickMs;
+      const double absorbedMl = pendingMl * soakFraction;
+      pendingMl -= absorbedMl;
+      moisture = std::min(100.0, std::max(0.0, moisture + absorbedMl * model.gainPerMl));
+
+      // Same order as WatererController::run() - triggerPump(), then updatePumps()
+      if (shouldTriggerPump(settings, pumpOn, static_cast<int>(moisture), msSinceLastRun)) {
+        pumpOn = true;
+      }
+      if (updatePumpTimer(settings, &pumpOn, prevPumpOn, &pumpOffAtMs, &lastRunMs, now)) {
+        const double ml = std::min(tankMl, model.pumpFlowRate * settings.runDuration / 1000.0);
+        tankMl -= ml;
+        pendingMl += ml;
+        result.waterMl += ml;
+        result.pumpCycles++;
+        if (ml <= 0) result.emptyTankRuns++;
+      }
+      msSinceLastRun = now - lastRunMs;
+      prevPumpOn = pumpOn;
+
+      if (moisture < model.dryPercentage) {
+        result.dryMs += model.tickMs;
+      }
+    }
+
+    result.durationMs = samples.back().ms - samples[0].ms;
+    return result;
+  }
+
+ private:
+  const Trace& trace;
+  PlantModel model;
+  std::vector<double> dryingRates;  // Moisture change per ms, for each segment between samples
+  double typicalRate;  // Mean drying rate outside of any recorded pump runs
+
+  /**
+   * Moisture at `ms`, from the line at `dryingRate` through samples [from, to). Readings are
+   * truncated to whole percentages, so this is half a percent low - which cancels out when
+   * taking the difference of two of them.
+  */
+  static double meanLevelAt(const std::vector<TraceSample>& samples, size_t from, size_t to, long ms,
+      double dryingRate, int plant) {
+    double sum = 0;
+    for (size_t i = from; i < to; i++) {
+      sum += samples[i].moisturePct[plant] - dryingRate * (samples[i].ms - ms);
+    }
+    return sum / (to - from);
+  }
+
+  void computeDryingRates() {
+    const std::vector<TraceSample>& samples = trace.samples;
+    std::vector<bool> watered(samples.size(), false);
+
+    // Anything within a few soak times of a recorded run includes water we're replacing
+    for (size_t i = 0; i + 1 < samples.size(); i++) {
+      if (samples[i + 1].pumpRuns[model.plant] <= samples[i].pumpRuns[model.plant]) continue;
+      for (size_t j = i; j < samples.size() && samples[j].ms - samples[i].ms <= 3 * model.soakTime; j++) {
+        watered[j] = true;
+      }
+    }
+
+    double totalDrop = 0;
+    double totalMs = 0;
+    dryingRates.assign(samples.size(), 0);
+    for (size_t i = 0; i + 1 < samples.size(); i++) {
+      const double deltaMs = samples[i + 1].ms - samples[i].ms;
+      if (watered[i] || deltaMs <= 0) continue;
+
+      // Ignore rises (noise, someone watering by hand) - we only want the drying
+      const double drop = std::min(0, samples[i + 1].moisturePct[model.plant] - samples[i].moisturePct[model.plant]);
+      dryingRates[i] = drop / deltaMs;
+      totalDrop += drop;
+      totalMs += deltaMs;
+    }
+
+    // The readings step at the moment the moisture passes a whole percentage, so timing the steps
+    // within each dry stretch gets the rate without the up to 1% truncation at the stretch's ends
+    double stepDrop = 0;
+    double stepMs = 0;
+    size_t lastStep = samples.size();  // None yet in this stretch
+    for (size_t i = 0; i + 1 < samples.size(); i++) {
+      if (watered[i]) {
+        lastStep = samples.size();
+        continue;
+      }
+      if (samples[i + 1].moisturePct[model.plant] < samples[i].moisturePct[model.plant]) {
+        if (lastStep < samples.size()) {
+          stepDrop += samples[i + 1].moisturePct[model.plant] - samples[lastStep].moisturePct[model.plant];
+          stepMs += samples[i + 1].ms - samples[lastStep].ms;
+        }
+        lastStep = i + 1;
+      }
+    }
+
+    typicalRate = (0 < stepMs) ? stepDrop / stepMs : (0 < totalMs) ? totalDrop / totalMs : 0;
+    for (size_t i = 0; i < samples.size(); i++) {
+      if (watered[i]) dryingRates[i] = typicalRate;
+    }
+  }
+};
+
+#endif  // GUARD_905EFA78_6AA0_4C70_B326_1D0F3BE172BA_H_
@@ -0,0 +1,102 @@
+/**
+MIT License
+Copyright (c) 2023 Adam Borocz
+*/
+#ifndef GUARD_BA63C47B_2404_4749_B5CA_4A6A577F3089_H_
+#define GUARD_BA63C47B_2404_4749_B5CA_4A6A577F3089_H_
+#include <stddef.h>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Runs `taskCount` independent tasks across a fixed set of threads.
+ *
+ * Tasks are dealt out to per-thread deques up front. Each thread works from the back of its own
+ * deque, and once that's empty it steals from the front of someone else's - so threads that
+ * drew cheap tasks help out the ones that didn't, without any central queue to fight over.
+ */
+class WorkStealingPool {
+ public:
+  /**
+   * @param threadCount Number of worker threads - 0 to use one per core
+  */
+  explicit WorkStealingPool(unsigned threadCount = 0) {
+    if (threadCount == 0) threadCount = std::thread::hardware_concurrency();
+    this->threadCount = std::max(1u, threadCount);
+  }
+
+  unsigned getThreadCount() {
+    return threadCount;
+  }
+
+  /**
+   * Call `task(i)` for every i in [0, taskCount), returning once they've all finished.
+   * Tasks must not throw.
+  */
+  void run(size_t taskCount, const std::function<void(size_t)>& task) {
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    for (unsigned i = 0; i < threadCount; i++) {
+      queues.emplace_back(new WorkQueue());
+    }
+    // Deal contiguous runs to each thread, so neighbouring tasks usually stay together
+    for (size_t i = 0; i < taskCount; i++) {
+      queues[i * threadCount / taskCount]->tasks.push_back(i);
+    }
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < threadCount; i++) {
+      threads.emplace_back([&, i]() { work(&queues, i, task); });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+
+ private:
+  struct WorkQueue {
+    std::mutex mutex;
+    std::deque<size_t> tasks;
+  };
+
+  unsigned threadCount;
+
+  static void work(
+    std::vector<std::unique_ptr<WorkQueue>>* queues,
+    unsigned self,
+    const std::function<void(size_t)>& task
+  ) {
+    size_t next;
+    while (popOwn((*queues)[self].get(), &next) || steal(queues, self, &next)) {
+      task(next);
+    }
+  }
+
+  static bool popOwn(WorkQueue* queue, size_t* next) {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (queue->tasks.empty()) return false;
+    *next = queue->tasks.back();
+    queue->tasks.pop_back();
+    return true;
+  }
+
+  // Nothing new is ever queued once we've started, so if every deque is empty we're done
+  static bool steal(std::vector<std::unique_ptr<WorkQueue>>* queues, unsigned self, size_t* next) {
+    const size_t count = queues->size();
+    for (size_t offset = 1; offset < count; offset++) {
+      WorkQueue* victim = (*queues)[(self + offset) % count].get();
+      std::lock_guard<std::mutex> lock(victim->mutex);
+      if (victim->tasks.empty()) continue;
+      *next = victim->tasks.front();
+      victim->tasks.pop_front();
+      return true;
+    }
+    return false;
+  }
+};
+
+#endif  // GUARD_BA63C47B_2404_4749_B5CA_4A6A577F3089_H_
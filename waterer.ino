@@ -30,6 +30,14 @@ WatererController watererController(
   true
 );
 
+// Defined here rather than in moistureAdc.h, so there's only ever one copy
+MoistureAdc* MoistureAdc::instance = NULL;
+
+// Only MoistureAdc uses the DMAC - forward anything else here if that changes
+extern "C" void DMAC_Handler(void) {
+  MoistureAdc::onTransferComplete();
+}
+
 void setup() {
   Serial.begin(9600);
   watererController.init();
@@ -8,6 +8,10 @@ Copyright (c) 2023 Adam Borocz
 #include <Arduino_MKRIoTCarrier.h>
 #include "waterLevelSensor.h"
 #include "moistureSensor.h"
+#include "flashStore.h"
+#include "samdFlash.h"
+#include "watererLogic.h"
+#include "sensorHistory.h"
 
 const String PROGMEM okStr = "OK";
 const String PROGMEM warnStr = "WARN";
@@ -28,9 +32,27 @@ const long PROGMEM pump1CheckInterval = 60000;  // How frequently to check wheth
 const int PROGMEM moisture1TriggerThreshold = 50;  // Only auto trigger pump below this threshold
 const long PROGMEM pump2CheckInterval = 67000;
 const int PROGMEM moisture2TriggerThreshold = 50;
+const long PROGMEM pumpRunDuration = 5000;  // How long each pump run lasts
+
+const PumpSettings PROGMEM pump1Settings = {moisture1TriggerThreshold, pump1CheckInterval, pumpRunDuration};
+const PumpSettings PROGMEM pump2Settings = {moisture2TriggerThreshold, pump2CheckInterval, pumpRunDuration};
 
 const int PROGMEM warnPercentage = 50;
 const int PROGMEM criticalPercentage = 25;
+const LevelThresholds PROGMEM levelThresholds = {warnPercentage, criticalPercentage};
+
+const unsigned long PROGMEM trendWindowMs = 86400000;  // How far back the trend screen goes
+const int PROGMEM trendLeft = 40;  // Sparkline position & size, kept inside the round display
+const int PROGMEM trendWidth = 160;
+const int PROGMEM trendHeight = 32;
+
+// How often to print a TRACE line to serial - capture these to tune the values above
+// with tools/thresholdSweep
+const long PROGMEM traceInterval = 60000;
+
+// Longest we'll hold on to changed state before writing it to flash. Pumps switching off
+// are always written straight away.
+const long PROGMEM stateFlushInterval = 900000;
 
 class WatererController {
  public:
@@ -45,18 +67,20 @@ class WatererController {
     int maxWaterLevel = 80,  // At what sensor percentage is the water tank full (find via testing)
     int pumpFlowRate = 8,  // In mL/s (find via testing)
     bool isPlant2Enabled = true  // Set to false if only one plant is being monitored/watered
-  ) : carrier(), moisture1Sensor(moisture1Pin), moisture2Sensor(moisture2Pin) {
+  ) : carrier(), moisture1Sensor(moisture1Pin), moisture2Sensor(moisture2Pin), stateStore(&stateFlash) {
     this->waterLevelPct = waterLevelPct;
     this->moisture1Pct = moisture1Pct;
     this->moisture2Pct = moisture2Pct;
     this->pump1On = pump1On;
     prevPump1On = false;
     pump1LastRunMs = 0;
+    pump1RunCount = 0;
     this->pump1MsSinceLastRun = 0;
     this->pump1SecsSinceLastRun = pump1SecsSinceLastRun;
     this->pump2On = pump2On;
     prevPump2On = false;
     pump2LastRunMs = 0;
+    pump2RunCount = 0;
     this->pump2MsSinceLastRun = 0;
     this->pump2SecsSinceLastRun = pump2SecsSinceLastRun;
     this->maxWaterLevel = maxWaterLevel;
@@ -64,6 +88,9 @@ class WatererController {
     this->isPlant2Enabled = isPlant2Enabled;
     currentMillis = millis();
     prevMillis = 0;
+    lastStateFlushMs = 0;
+    lastTraceMs = 0;
+    prevTrendVersion = 0;
   }
 
   void init() {
@@ -85,9 +112,12 @@ class WatererController {
     }
 
     waterLevelSensor.init();
+    initMoistureAdc();
 
     carrier.display.setRotation(0);
     carrier.display.setTextWrap(true);
+
+    restoreState();
   }
 
   // Business logic for loop() function
@@ -109,6 +139,8 @@ class WatererController {
 
     triggerPump();  // Scheduled turn on for pumps
     updatePumps();  // Put this here because state might change due to button press
+    saveState();
+    printTrace();
     drawScreen();
 
     updatePrevValues();
@@ -131,11 +163,13 @@ class WatererController {
   bool* pump1On;
   bool prevPump1On;
   long pump1LastRunMs;
+  long pump1RunCount;
   long pump1MsSinceLastRun;
   int* pump1SecsSinceLastRun;
   bool* pump2On;
   bool prevPump2On;
   long pump2LastRunMs;
+  long pump2RunCount;
   long pump2MsSinceLastRun;
   int* pump2SecsSinceLastRun;
   long pump1OffAtMillis;
@@ -144,6 +178,8 @@ class WatererController {
   int maxWaterLevel;
   int pumpFlowRate;
 
+  long lastTraceMs;
+
   bool isPlant2Enabled;
 
   enum SystemStatus {
@@ -156,10 +192,38 @@ class WatererController {
   SystemStatus systemStatus = green;  // Current system status
   SystemStatus prevSystemStatus;  // System status in previous iteration
 
+  MoistureAdc moistureAdc;
   MoistureSensor moisture1Sensor;
   MoistureSensor moisture2Sensor;
   WaterLevelSensor waterLevelSensor;
 
+  SensorHistory waterLevelHistory;
+  SensorHistory moisture1History;
+  SensorHistory moisture2History;
+  uint32_t prevTrendVersion;  // History version the trend screen was last drawn from
+
+  SamdFlash stateFlash;
+  FlashStore<SamdFlash> stateStore;  // Keeps pump timers, counters & calibration across reboots
+  long lastStateFlushMs;
+
+  enum StateKey {
+    pump1StateKey,
+    pump2StateKey,
+    moisture1RangeKey,
+    moisture2RangeKey
+  };
+
+  struct PumpState {
+    uint32_t runCount;
+    // Capped at the check interval, so this stops changing (and being written) once the pump is due
+    uint32_t msSinceLastRun;
+  };
+
+  struct MoistureRange {
+    int16_t lowestVal;
+    int16_t highestVal;
+  };
+
   enum WatererScreen {
     blankScreen,  // TODO - Implement optional instead?
     statusScreen,
@@ -167,7 +231,8 @@ class WatererController {
     moisture1Screen,
     pump1Screen,
     moisture2Screen,
-    pump2Screen
+    pump2Screen,
+    trendScreen
   };
 
   enum Plant {
@@ -191,26 +256,28 @@ class WatererController {
         if (isPlant2Enabled) {
           return moisture2Screen;
         } else {
-          return statusScreen;
+          return trendScreen;
         }
       case moisture2Screen: return pump2Screen;
-      case pump2Screen: return statusScreen;
+      case pump2Screen: return trendScreen;
+      case trendScreen: return statusScreen;
     }
   }
 
   WatererScreen getPreviousScreen() {
     switch (currentScreen) {
-      case statusScreen:
-        if (isPlant2Enabled) {
-          return pump2Screen;
-        } else {
-          return pump1Screen;
-        }
+      case statusScreen: return trendScreen;
       case waterLevelScreen: return statusScreen;
       case moisture1Screen: return waterLevelScreen;
       case pump1Screen: return moisture1Screen;
       case moisture2Screen: return pump1Screen;
       case pump2Screen: return moisture2Screen;
+      case trendScreen:
+        if (isPlant2Enabled) {
+          return pump2Screen;
+        } else {
+          return pump1Screen;
+        }
     }
   }
 
@@ -235,19 +302,11 @@ class WatererController {
   }
 
   void triggerPump() {
-    if (
-      !*pump1On
-      && *moisture1Pct < moisture1TriggerThreshold
-      && pump1CheckInterval < pump1MsSinceLastRun
-    ) {
+    if (shouldTriggerPump(pump1Settings, *pump1On, *moisture1Pct, pump1MsSinceLastRun)) {
       *pump1On = true;
     }
 
-    if (
-      !*pump2On
-      && *moisture2Pct < moisture2TriggerThreshold
-      && pump2CheckInterval < pump2MsSinceLastRun
-    ) {
+    if (shouldTriggerPump(pump2Settings, *pump2On, *moisture2Pct, pump2MsSinceLastRun)) {
       *pump2On = true;
     }
   }
@@ -272,6 +331,9 @@ class WatererController {
       case pump2Screen:
         drawPumpScreen(plantTwo);
         break;
+      case trendScreen:
+        drawTrendScreen();
+        break;
       default:
         break;
     }
@@ -400,12 +462,10 @@ class WatererController {
   }
 
   int colourForPercentage(int pct) {
-    if (pct <= criticalPercentage) {
-      return ST77XX_RED;
-    } else if (pct <= warnPercentage) {
-      return ST77XX_YELLOW;
-    } else {
-      return ST77XX_BLUE;
+    switch (statusForLevel(levelThresholds, pct)) {
+      case levelCritical: return ST77XX_RED;
+      case levelWarn: return ST77XX_YELLOW;
+      default: return ST77XX_BLUE;
     }
   }
 
@@ -466,12 +526,80 @@ class WatererController {
     carrier.display.drawCircle(120, 120, 112, colour);
   }
 
+  void initMoistureAdc() {
+    const int moisturePins[] = {moisture1Pin, moisture2Pin};
+
+    if (moistureAdc.init(moisturePins, isPlant2Enabled ? 2 : 1)) {
+      moisture1Sensor.attachAdc(&moistureAdc, 0);
+      if (isPlant2Enabled) {
+        moisture2Sensor.attachAdc(&moistureAdc, 1);
+      }
+    } else {
+      Serial.println(F("Could not start DMA sampling, falling back to analogRead()"));
+    }
+  }
+
+  void drawTrendScreen() {
+    // All histories are fed together, so they all get new buckets at the same time
+    const int tier = waterLevelHistory.tierForWindow(trendWindowMs, trendWidth);
+    const uint32_t version = waterLevelHistory.getVersion(tier);
+
+    if (prevScreen != currentScreen) {
+      carrier.display.fillScreen(ST77XX_BLACK);
+      carrier.display.setTextColor(ST77XX_WHITE);
+      writeCenteredText(F("Last 24h"), 2, 120, 35);
+      carrier.display.setTextColor(ST77XX_BLUE);
+      writeCenteredText(F("Water Level"), 1, 120, 55);
+      carrier.display.setTextColor(ST77XX_GREEN);
+      writeCenteredText(F("Moisture 1"), 1, 120, 105);
+      if (isPlant2Enabled) {
+        writeCenteredText(F("Moisture 2"), 1, 120, 155);
+      }
+    } else if (prevTrendVersion == version) {
+      return;  // Nothing new since the last redraw
+    }
+
+    drawSparkline(&waterLevelHistory, tier, 62, ST77XX_BLUE);
+    drawSparkline(&moisture1History, tier, 112, ST77XX_GREEN);
+    if (isPlant2Enabled) {
+      drawSparkline(&moisture2History, tier, 162, ST77XX_GREEN);
+    }
+    prevTrendVersion = version;
+  }
+
+  // Min-max bar for each bucket in the trend window (oldest on the left), with the mean in white
+  void drawSparkline(SensorHistory* history, int tier, int top, int colour) {
+    const int slots = trendWindowMs / historyTierBucketMs[tier];
+    const int buckets = min(history->getBucketCount(tier), slots);
+    const int bottom = top + trendHeight - 1;
+
+    carrier.display.fillRect(trendLeft, top, trendWidth, trendHeight, ST77XX_BLACK);
+    carrier.display.drawFastHLine(trendLeft, bottom + 1, trendWidth, ST77XX_WHITE);
+
+    for (int age = 0; age < buckets; age++) {
+      const HistoryBucket bucket = history->getBucket(tier, age);
+      if (bucket.meanPct == SensorHistory::noData) continue;
+
+      const int x = trendLeft + (slots - 1 - age) * trendWidth / slots;
+      const int minY = bottom - bucket.minPct * (trendHeight - 1) / 100;
+      const int maxY = bottom - bucket.maxPct * (trendHeight - 1) / 100;
+      carrier.display.drawFastVLine(x, maxY, minY - maxY + 1, colour);
+      carrier.display.drawPixel(x, bottom - bucket.meanPct * (trendHeight - 1) / 100, ST77XX_WHITE);
+    }
+  }
+
   void updateSensorValues() {
     updateWaterLevel();
     updateMoisturePct(plantOne);
     if (isPlant2Enabled) {
       updateMoisturePct(plantTwo);
     }
+
+    waterLevelHistory.addSample(*waterLevelPct, currentMillis);
+    moisture1History.addSample(*moisture1Pct, currentMillis);
+    if (isPlant2Enabled) {
+      moisture2History.addSample(*moisture2Pct, currentMillis);
+    }
   }
 
   void updateWaterLevel() {
@@ -498,12 +626,16 @@ class WatererController {
   }
 
   void updateSystemStatus() {
-    if (*waterLevelPct <= criticalPercentage) {
-      systemStatus = critical;
-    } else if (*waterLevelPct <= warnPercentage) {
-      systemStatus = warn;
-    } else {
-      systemStatus = green;
+    switch (statusForLevel(levelThresholds, *waterLevelPct)) {
+      case levelCritical:
+        systemStatus = critical;
+        break;
+      case levelWarn:
+        systemStatus = warn;
+        break;
+      default:
+        systemStatus = green;
+        break;
     }
   }
 
@@ -518,34 +650,95 @@ class WatererController {
 
   void updatePump(Plant plant) {
     bool* pumpOn = (plant == plantOne) ? pump1On : pump2On;
-    bool* prevPumpOn = (plant == plantOne) ? &prevPump1On : &prevPump2On;
+    const bool prevPumpOn = (plant == plantOne) ? prevPump1On : prevPump2On;
     long* pumpOffAtMillis = (plant == plantOne) ? &pump1OffAtMillis : &pump2OffAtMillis;
+    long* pumpLastRunMs = (plant == plantOne) ? &pump1LastRunMs : &pump2LastRunMs;
+    const PumpSettings& settings = (plant == plantOne) ? pump1Settings : pump2Settings;
 
-    if (*pumpOn) {
-      if (!*prevPumpOn) {  // Previously off - set timer
-        *pumpOffAtMillis = currentMillis + 5000;
-      } else {  // Previously on - check timer
-        if (*pumpOffAtMillis <= currentMillis) {  // Timer passed - turn off
-          *pumpOn = false;
-        }
-      }
+    if (updatePumpTimer(settings, pumpOn, prevPumpOn, pumpOffAtMillis, pumpLastRunMs, currentMillis)) {
+      (plant == plantOne) ? pump1RunCount++ : pump2RunCount++;
     }
 
     // Update relay status
     if (*pumpOn) {
       // It seems like the lights are the other way around - light is *on* when relay is Open...
-      if (plant == plantOne) {
-        carrier.Relay1.open();
-        pump1LastRunMs = currentMillis;
-      } else {
-        carrier.Relay2.open();
-        pump2LastRunMs = currentMillis;
-      }
+      (plant == plantOne) ? carrier.Relay1.open() : carrier.Relay2.open();
     } else {
       (plant == plantOne) ? carrier.Relay1.close() : carrier.Relay2.close();
     }
   }
 
+  void restoreState() {
+    if (!stateStore.init()) {
+      Serial.println(F("No saved state found"));
+      return;
+    }
+
+    PumpState pumpState;
+    if (stateStore.get(pump1StateKey, &pumpState, sizeof(pumpState))) {
+      pump1RunCount = pumpState.runCount;
+      pump1LastRunMs = currentMillis - static_cast<long>(pumpState.msSinceLastRun);
+      pump1MsSinceLastRun = pumpState.msSinceLastRun;  // So the first triggerPump() already sees it
+    }
+    if (stateStore.get(pump2StateKey, &pumpState, sizeof(pumpState))) {
+      pump2RunCount = pumpState.runCount;
+      pump2LastRunMs = currentMillis - static_cast<long>(pumpState.msSinceLastRun);
+      pump2MsSinceLastRun = pumpState.msSinceLastRun;  // So the first triggerPump() already sees it
+    }
+
+    MoistureRange range;
+    if (stateStore.get(moisture1RangeKey, &range, sizeof(range))) {
+      moisture1Sensor.restoreObservedRange(range.lowestVal, range.highestVal);
+    }
+    if (stateStore.get(moisture2RangeKey, &range, sizeof(range))) {
+      moisture2Sensor.restoreObservedRange(range.lowestVal, range.highestVal);
+    }
+  }
+
+  // Stage current state in the store, only writing it to flash when it's worth it
+  void saveState() {
+    PumpState pumpState;
+    pumpState.runCount = pump1RunCount;
+    pumpState.msSinceLastRun = min(pump1MsSinceLastRun, pump1CheckInterval);
+    stateStore.put(pump1StateKey, &pumpState, sizeof(pumpState));
+    pumpState.runCount = pump2RunCount;
+    pumpState.msSinceLastRun = min(pump2MsSinceLastRun, pump2CheckInterval);
+    stateStore.put(pump2StateKey, &pumpState, sizeof(pumpState));
+
+    MoistureRange range;
+    range.lowestVal = moisture1Sensor.getLowestVal();
+    range.highestVal = moisture1Sensor.getHighestVal();
+    stateStore.put(moisture1RangeKey, &range, sizeof(range));
+    range.lowestVal = moisture2Sensor.getLowestVal();
+    range.highestVal = moisture2Sensor.getHighestVal();
+    stateStore.put(moisture2RangeKey, &range, sizeof(range));
+
+    const bool pumpStopped = (prevPump1On && !*pump1On) || (prevPump2On && !*pump2On);
+    if (pumpStopped || stateFlushInterval <= currentMillis - lastStateFlushMs) {
+      stateStore.flush();  // No-op if nothing changed
+      lastStateFlushMs = currentMillis;
+    }
+  }
+
+  // TRACE,<ms>,<moisture 1 %>,<moisture 2 %>,<water level %>,<pump 1 runs>,<pump 2 runs>
+  void printTrace() {
+    if (currentMillis - lastTraceMs < traceInterval) return;
+    lastTraceMs = currentMillis;
+
+    Serial.print(F("TRACE,"));
+    Serial.print(currentMillis);
+    Serial.print(',');
+    Serial.print(*moisture1Pct);
+    Serial.print(',');
+    Serial.print(*moisture2Pct);
+    Serial.print(',');
+    Serial.print(*waterLevelPct);
+    Serial.print(',');
+    Serial.print(pump1RunCount);
+    Serial.print(',');
+    Serial.println(pump2RunCount);
+  }
+
   void updatePrevValues() {
     prevMillis = currentMillis;
     prevSystemStatus = systemStatus;
@@ -0,0 +1,77 @@
+/**
+MIT License
+Copyright (c) 2023 Adam Borocz
+*/
+#ifndef GUARD_34D2A738_A4BA_4874_B168_4678A6800E18_H_
+#define GUARD_34D2A738_A4BA_4874_B168_4678A6800E18_H_
+
+// Decision rules shared between WatererController and the host-side tools (see tools/thresholdSweep),
+// so keep this free of any Arduino dependencies.
+
+struct PumpSettings {
+  int triggerThreshold;  // Only auto trigger pump below this moisture percentage
+  long checkInterval;  // Minimum time between the pump last running and triggering it again, in ms
+  long runDuration;  // How long the pump runs for each time, in ms
+};
+
+struct LevelThresholds {
+  int warnPercentage;
+  int criticalPercentage;
+};
+
+enum LevelStatus {
+  levelOk,
+  levelWarn,
+  levelCritical
+};
+
+// Whether a scheduled pump run should start
+inline bool shouldTriggerPump(const PumpSettings& settings, bool pumpOn, int moisturePct, long msSinceLastRun) {
+  return !pumpOn
+    && moisturePct < settings.triggerThreshold
+    && settings.checkInterval < msSinceLastRun;
+}
+
+/**
+ * Advance a pump's run timer by one loop, after any trigger or button press has set `pumpOn`.
+ * Starts the timer when the pump has just been switched on, switches it off once the timer
+ * has passed, and keeps `pumpLastRunMs` at the current time for as long as it's running.
+ * @param prevPumpOn Whether the pump was on in the previous loop
+ * @return true if a run has just started
+*/
+inline bool updatePumpTimer(
+  const PumpSettings& settings,
+  bool* pumpOn,
+  bool prevPumpOn,
+  long* pumpOffAtMillis,
+  long* pumpLastRunMs,
+  long currentMillis
+) {
+  bool started = false;
+
+  if (*pumpOn) {
+    if (!prevPumpOn) {  // Previously off - set timer
+      *pumpOffAtMillis = currentMillis + settings.runDuration;
+      started = true;
+    } else if (*pumpOffAtMillis <= currentMillis) {  // Timer passed - turn off
+      *pumpOn = false;
+    }
+  }
+
+  if (*pumpOn) {
+    *pumpLastRunMs = currentMillis;
+  }
+  return started;
+}
+
+inline LevelStatus statusForLevel(const LevelThresholds& thresholds, int pct) {
+  if (pct <= thresholds.criticalPercentage) {
+    return levelCritical;
+  } else if (pct <= thresholds.warnPercentage) {
+    return levelWarn;
+  } else {
+    return levelOk;
+  }
+}
+
+#endif  // GUARD_34D2A738_A4BA_4874_B168_4678A6800E18_H_